@@ -0,0 +1,113 @@
+#include "autotune.h"
+#include "fastmatch.h"
+
+#include<algorithm>
+#include<chrono>
+#include<random>
+#include<fstream>
+
+bool Autotune_Parameters(const char* fastq, const std::vector<std::string>& seeds,
+        int sample_reads, double target, TuneChoice& choice, std::ostream& report)
+{
+    std::unordered_map<int, std::string> sample;
+    std::vector<int> lengths;
+    std::ifstream ifastq(fastq); std::string buffer_line;
+    int line_counter = 0;
+    while(lengths.size() < sample_reads && std::getline(ifastq, buffer_line, '\n'))
+    {
+	if(line_counter++ % 4 != 1) continue;
+	lengths.push_back(buffer_line.size());
+	sample[lengths.size()] = buffer_line;
+    }
+    if(lengths.empty()) return false;
+
+    std::vector<int> sorted_lengths = lengths;
+    std::sort(sorted_lengths.begin(), sorted_lengths.end());
+    int median = sorted_lengths[sorted_lengths.size() / 2];
+    int L = median * 7 / 15;	// 70 and 60 for 150 nt reads, leaving room
+    int K = median * 2 / 5;	// for the K-mer vote behind the L-suffix
+    report << "Sampled " << lengths.size() << " reads, length min " << sorted_lengths.front()
+           << " median " << median << " max " << sorted_lengths.back()
+           << ", L = " << L << ", K = " << K << "\n";
+
+    // L-long substrings of sampled reads, their origin must be found back
+    std::mt19937 rng(330);
+    std::vector<std::string> queries;
+    std::vector<std::pair<int, int> > origins;
+    for(int attempt = 0; attempt < 2000 && queries.size() < 500; attempt++)
+    {
+	int read_id = rng() % lengths.size() + 1;
+	if(lengths[read_id - 1] < L) continue;
+	int pos = rng() % (lengths[read_id - 1] - L + 1);
+	queries.push_back(sample[read_id].substr(pos, L));
+	origins.push_back(std::make_pair(read_id, pos));
+    }
+    for(auto& x : seeds)
+	if(x.size() >= L) queries.push_back(x.substr(x.size() - L));
+
+    const int Ms[] = {2, 3, 4, 6, 8, 11};	// small M keep some pairs for short reads
+    const int Qs[] = {6, 8, 10, 12};
+    bool chosen = false;
+    report << "M\tQ\tdropped\tskew\tcand/hit\tus/query\tsensitivity\n";
+    for(int M : Ms) for(int Q : Qs)
+    {
+	if(M * Q > L) continue;	// some phases of the pattern would have no Q-gramm
+
+	TuneChoice tried;
+	tried.M = M; tried.Q = Q; tried.L = L; tried.K = K;
+
+	std::unordered_map<std::string, std::vector<int> > qgramm_lib;
+	Preprocess_Collection(M, Q, sample, qgramm_lib);
+
+	int dropped = 0;
+	for(int x : lengths) if(M * Q >= x) dropped++;
+	tried.dropped = double(dropped) / lengths.size();
+
+	size_t longest = 0, postings = 0;
+	for(auto& x : qgramm_lib) {
+	    longest = std::max(longest, x.second.size() / 2); postings += x.second.size() / 2;
+	}
+	tried.skew = qgramm_lib.empty() ? 0 : longest / (double(postings) / qgramm_lib.size());
+
+	Locate_Workspace ws;
+	std::vector<Hit> hits;
+	size_t candidates = 0, verified = 0; int found = 0;
+	auto start = std::chrono::steady_clock::now();
+	for(size_t q = 0; q < queries.size(); q++)
+	{
+	    Locate_Pattern_With_MM(queries[q], M, Q, sample, qgramm_lib, 0, hits, ws);
+	    candidates += ws.candidates_seen; verified += hits.size();
+	    if(q >= origins.size()) continue;
+	    for(auto& x : hits)
+		if(x.read_id == origins[q].first && x.pos == origins[q].second) {
+		    found++; break;
+		}
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+	    std::chrono::steady_clock::now() - start).count();
+	tried.candidates_per_hit = double(candidates) / std::max<size_t>(verified, 1);
+	tried.us_per_query = double(elapsed) / std::max<size_t>(queries.size(), 1);
+	tried.sensitivity = origins.empty() ? 0 : double(found) / origins.size();
+
+	report << M << "\t" << Q << "\t" << tried.dropped << "\t" << tried.skew << "\t"
+	       << tried.candidates_per_hit << "\t" << tried.us_per_query << "\t"
+	       << tried.sensitivity << "\n";
+
+	bool meets = tried.sensitivity >= target;
+	bool chosen_meets = chosen && choice.sensitivity >= target;
+	if(!chosen || (meets && (!chosen_meets || tried.us_per_query < choice.us_per_query)) ||
+	   (!meets && !chosen_meets && tried.sensitivity > choice.sensitivity))
+	{
+	    choice = tried; chosen = true;
+	}
+    }
+    if(!chosen)
+    {
+	std::cerr << "Autotune: reads of median length " << median << " give L = " << L
+	          << ", no M, Q pair has M * Q <= L\n";
+	return false;
+    }
+    report << "Chosen M = " << choice.M << ", Q = " << choice.Q << ", L = " << choice.L
+           << ", K = " << choice.K << " (sensitivity " << choice.sensitivity << ")\n";
+    return true;
+}
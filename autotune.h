@@ -0,0 +1,42 @@
+#ifndef TALIGNER_AUTOTUNE
+#define TALIGNER_AUTOTUNE
+
+#include<string>
+#include<vector>
+
+#include<iostream>
+
+
+/*
+ * Parameters chosen by Autotune_Parameters and what was measured for them
+ */
+
+struct TuneChoice
+{
+    int M;
+    int Q;
+    int L;
+    int K;
+    double dropped;		// fraction of reads not indexed as M * Q >= read size
+    double skew;		// longest / mean Q-gramm postings
+    double candidates_per_hit;	// putative matches checked per verified one
+    double us_per_query;
+    double sensitivity;		// fraction of sampled read substrings found back
+};
+
+/*
+ * Interface function!
+ * Samples first sample_reads reads of FASTQ file.
+ * L and K are derived from the median read length, then for each (M, Q) pair
+ * with M * Q <= L the sample is indexed and L-long substrings of sampled reads
+ * and L-suffixes of seeds are located. The fastest pair with sensitivity
+ * of at least target is chosen, or the most sensitive one if none reaches it.
+ * Measurements of all pairs are printed to report.
+ * Returns false if no read was sampled or reads are too short for any pair.
+ */
+
+bool Autotune_Parameters(const char* fastq, const std::vector<std::string>& seeds,
+        int sample_reads, double target, TuneChoice& choice, std::ostream& report);
+
+
+#endif
@@ -0,0 +1,406 @@
+#include "extmatch.h"
+#include "dnacommon.h"
+
+#include<algorithm>
+#include<queue>
+#include<cstdio>
+
+uint64_t Encode_Qgramm(const std::string& s, size_t start, int Q)
+{
+    uint64_t code = 0;
+    for(size_t i = start; i < start + Q; i++)
+    {
+        uint64_t c;
+        switch(s[i]) {
+            case 'A' : c = 1; break;
+            case 'C' : c = 2; break;
+            case 'G' : c = 3; break;
+            case 'T' : c = 4; break;
+            case 'N' : c = 5; break;
+            default: c = 6;	// any other symbol collides here, it is resolved
+        }			// by the verification of putative matches
+        code = (code << 3) | c;
+    }
+    return code;
+}
+
+static bool Qgramm_Record_Less(const QgrammRecord& a, const QgrammRecord& b)
+{
+    if(a.qgramm != b.qgramm) return a.qgramm < b.qgramm;
+    if(a.read_id != b.read_id) return a.read_id < b.read_id;
+    return a.pos < b.pos;
+}
+
+static std::string Run_File(const std::string& prefix, int run)
+{
+    return prefix + ".run" + libdna::i2s(run);
+}
+
+static void Remove_Files(const std::vector<std::string>& files)
+{
+    for(auto& x : files) std::remove(x.c_str());
+}
+
+/*
+ * Sorts run and writes it to the next run file, the name is recorded
+ * in run_files before writing so that a partial file is removed as well
+ */
+
+static bool Spill_Run(std::vector<QgrammRecord>& run, const std::string& prefix,
+        int& runs_made, std::vector<std::string>& run_files)
+{
+    std::sort(run.begin(), run.end(), Qgramm_Record_Less);
+    run_files.push_back(Run_File(prefix, runs_made++));
+    std::ofstream orun(run_files.back(), std::ios::binary);
+    orun.write(reinterpret_cast<const char*>(run.data()), run.size() * sizeof(QgrammRecord));
+    orun.close();
+    run.clear();
+    return !orun.fail();
+}
+
+/*
+ * Sequential reader of one sorted run, keeps chunk records in memory.
+ * Read error or a partial record at the end of the run sets failed.
+ */
+
+struct RunReader
+{
+    std::ifstream in;
+    std::vector<QgrammRecord> chunk;
+    size_t at;
+    size_t loaded;
+    bool failed;
+
+    bool Next(QgrammRecord& rec)
+    {
+        if(at == loaded)
+        {
+            size_t wanted = chunk.size() * sizeof(QgrammRecord);
+            in.read(reinterpret_cast<char*>(chunk.data()), wanted);
+            size_t got = in.gcount();
+            if(in.bad() || (got < wanted && !in.eof()) || got % sizeof(QgrammRecord) != 0)
+            {
+                failed = true; return false;
+            }
+            loaded = got / sizeof(QgrammRecord); at = 0;
+            if(loaded == 0) return false;
+        }
+        rec = chunk[at++];
+        return true;
+    }
+};
+
+/*
+ * k-way merge of sorted runs with chunk_records buffered per run.
+ * Without odir the merged records go to out as a new run, otherwise
+ * out gets the postings pairs and odir the directory entries.
+ * Returns false if any run can not be read or output can not be written.
+ */
+
+static bool Merge_Runs(const std::vector<std::string>& run_files, size_t chunk_records,
+        std::ofstream& out, std::ofstream* odir)
+{
+    std::vector<RunReader> readers(run_files.size());
+    typedef std::pair<QgrammRecord, size_t> HeapItem;
+    auto heap_greater = [](const HeapItem& a, const HeapItem& b)
+        { return Qgramm_Record_Less(b.first, a.first); };
+    std::priority_queue<HeapItem, std::vector<HeapItem>, decltype(heap_greater)> heap(heap_greater);
+
+    for(size_t r = 0; r < run_files.size(); r++)
+    {
+        readers[r].in.open(run_files[r], std::ios::binary);
+        if(!readers[r].in)
+        {
+            std::cerr << "Can not open run file " << run_files[r] << "\n";
+            return false;
+        }
+        readers[r].chunk.resize(chunk_records);
+        readers[r].at = readers[r].loaded = 0;
+        readers[r].failed = false;
+        QgrammRecord rec;
+        if(readers[r].Next(rec)) heap.push(HeapItem(rec, r));
+    }
+
+    QgrammDirEntry entry; entry.count = 0; entry.offset = 0;
+    uint64_t written = 0;
+    while(!heap.empty() && out)
+    {
+        HeapItem top = heap.top(); heap.pop();
+        if(!odir)
+            out.write(reinterpret_cast<const char*>(&top.first), sizeof(QgrammRecord));
+        else
+        {
+            if(entry.count > 0 && entry.qgramm != top.first.qgramm)
+            {
+                odir->write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+                entry.count = 0;
+            }
+            if(entry.count == 0)
+            {
+                entry.qgramm = top.first.qgramm; entry.offset = written;
+            }
+            int pair[2] = {top.first.read_id, top.first.pos};
+            out.write(reinterpret_cast<const char*>(pair), sizeof(pair));
+            entry.count++; written++;
+        }
+
+        QgrammRecord rec;
+        if(readers[top.second].Next(rec)) heap.push(HeapItem(rec, top.second));
+    }
+    if(odir && entry.count > 0) odir->write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+
+    for(size_t r = 0; r < readers.size(); r++)
+        if(readers[r].failed)
+        {
+            std::cerr << "Can not read run file " << run_files[r] << "\n";
+            return false;
+        }
+    return out && (!odir || *odir);
+}
+
+/*
+ * Merges runs fan_in at a time into new run files until at most fan_in are left
+ */
+
+static bool Cascade_Runs(std::vector<std::string>& run_files, size_t fan_in,
+        size_t chunk_records, const std::string& prefix, int& runs_made)
+{
+    std::vector<std::string> merged;
+    while(run_files.size() > fan_in)
+    {
+        merged.clear();
+        for(size_t g = 0; g < run_files.size(); g += fan_in)
+        {
+            std::vector<std::string> group(run_files.begin() + g,
+                run_files.begin() + std::min(run_files.size(), g + fan_in));
+            if(group.size() == 1) { merged.push_back(group[0]); continue; }
+
+            merged.push_back(Run_File(prefix, runs_made++));
+            std::ofstream orun(merged.back(), std::ios::binary);
+            bool merged_ok = orun && Merge_Runs(group, chunk_records, orun, nullptr);
+            orun.close();
+            if(!merged_ok || orun.fail())
+            {
+                std::cerr << "Can not write run file " << merged.back() << "\n";
+                Remove_Files(merged);
+                return false;
+            }
+            Remove_Files(group);
+        }
+        run_files.swap(merged);
+    }
+    return true;
+}
+
+int Build_External_Index(const char* fastq, int M, int Q, size_t memory_budget,
+        const std::string& prefix)
+{
+    std::cout << "In Build_External_Index\n";
+    if(Q > EXTMATCH_MAX_Q)
+    {
+        std::cerr << "Q > " << EXTMATCH_MAX_Q << " is not supported by external index\n";
+        return -1;
+    }
+
+    // merge keeps a chunk per input run and one more for the heap and output,
+    // larger budgets get larger chunks rather than more open run files
+    if(memory_budget < 3 * EXTMATCH_MIN_CHUNK)
+    {
+        std::cerr << "Memory budget of external index is below "
+                  << 3 * EXTMATCH_MIN_CHUNK << " bytes\n";
+        return -1;
+    }
+    size_t chunk_bytes = std::max(EXTMATCH_MIN_CHUNK, memory_budget / (EXTMATCH_MAX_FAN_IN + 1));
+    size_t fan_in = std::min(memory_budget / chunk_bytes, EXTMATCH_MAX_FAN_IN + 1) - 1;
+    size_t chunk_records = chunk_bytes / sizeof(QgrammRecord);
+    size_t run_records = memory_budget / sizeof(QgrammRecord);
+
+    std::vector<QgrammRecord> run;
+    run.reserve(run_records);
+    std::vector<std::string> run_files;
+    int runs_made = 0;
+
+    const std::string index_files[] = {prefix + ".reads", prefix + ".roff",
+        prefix + ".qidx", prefix + ".qdir"};
+    std::vector<std::string> outputs(index_files, index_files + 4);
+
+    std::ifstream ifastq(fastq); std::string buffer_line, Mr;
+    if(!ifastq)
+    {
+        std::cerr << "Can not open " << fastq << "\n";
+        return -1;
+    }
+    std::ofstream oreads(index_files[0], std::ios::binary);
+    std::ofstream oroff(index_files[1], std::ios::binary);
+    uint64_t read_offset = 0;
+    oroff.write(reinterpret_cast<const char*>(&read_offset), sizeof(read_offset));
+
+    int line_counter = 0; int read_counter = 0;
+    bool spilled = true;
+    while(spilled && oreads && oroff && std::getline(ifastq, buffer_line, '\n')) {
+	if(line_counter++ % 4 != 1) continue;
+	read_counter++;
+	oreads.write(buffer_line.data(), buffer_line.size());
+	read_offset += buffer_line.size();
+	oroff.write(reinterpret_cast<const char*>(&read_offset), sizeof(read_offset));
+
+	if(M * Q >= buffer_line.size()) continue;
+	Mr.clear();
+	for(size_t i = 0; i < buffer_line.size(); i += M)
+	    Mr += buffer_line[i];
+	for(size_t i = 0; i + Q <= Mr.size() && spilled; i++)
+	{
+	    QgrammRecord rec;
+	    rec.qgramm = Encode_Qgramm(Mr, i, Q);
+	    rec.read_id = 2 * read_counter - 1;	// as Process_Reads_FASTQ numbers reads
+	    rec.pos = i * M;
+	    run.push_back(rec);
+	    if(run.size() == run_records) spilled = Spill_Run(run, prefix, runs_made, run_files);
+	}
+    }
+    if(spilled && !run.empty()) spilled = Spill_Run(run, prefix, runs_made, run_files);
+    std::vector<QgrammRecord>().swap(run);
+    oreads.close(); oroff.close();
+    if(!spilled || ifastq.bad() || oreads.fail() || oroff.fail())
+    {
+        std::cerr << "Can not write index " << prefix << "\n";
+        Remove_Files(run_files); Remove_Files(outputs);
+        return -1;
+    }
+
+    #ifdef DEBUG_FASTMATCH
+	std::cout << "Reads read from file " << fastq << ": " << read_counter
+	          << ", runs spilled: " << run_files.size() << std::endl;
+    #endif
+
+    if(!Cascade_Runs(run_files, fan_in, chunk_records, prefix, runs_made))
+    {
+        Remove_Files(run_files); Remove_Files(outputs);
+        return -1;
+    }
+
+    std::ofstream oidx(index_files[2], std::ios::binary);
+    std::ofstream odir(index_files[3], std::ios::binary);
+    int header[3] = {M, Q, read_counter};
+    odir.write(reinterpret_cast<const char*>(header), sizeof(header));
+    bool merged = oidx && odir && Merge_Runs(run_files, chunk_records, oidx, &odir);
+    oidx.close(); odir.close();
+    Remove_Files(run_files);
+    if(!merged || oidx.fail() || odir.fail())
+    {
+        std::cerr << "Can not write index " << prefix << "\n";
+        Remove_Files(outputs);
+        return -1;
+    }
+    std::cout << "Out Build_External_Index\n";
+    return read_counter;
+}
+
+bool Open_External_Index(const std::string& prefix, ExternalIndex& index)
+{
+    std::ifstream idir(prefix + ".qdir", std::ios::binary);
+    int header[3];
+    if(!idir.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+    index.M = header[0]; index.Q = header[1]; index.reads_count = header[2];
+
+    index.directory.clear();
+    QgrammDirEntry entry;
+    while(idir.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+        index.directory.push_back(entry);
+
+    index.reads.open(prefix + ".reads", std::ios::binary);
+    index.roff.open(prefix + ".roff", std::ios::binary);
+    index.postings.open(prefix + ".qidx", std::ios::binary);
+    return index.reads && index.roff && index.postings;
+}
+
+bool Fetch_External_Read(ExternalIndex& index, int read_id, std::string& read)
+{
+    if(read_id < 1 || read_id % 2 == 0 || read_id / 2 >= index.reads_count) return false;
+    uint64_t span[2];
+    index.roff.clear();		// a failed read of a previous call would block seekg
+    index.roff.seekg((read_id / 2) * sizeof(uint64_t));
+    if(!index.roff.read(reinterpret_cast<char*>(span), sizeof(span)) || span[1] < span[0])
+        return false;
+    read.resize(span[1] - span[0]);
+    index.reads.clear();
+    index.reads.seekg(span[0]);
+    return index.reads.read(&read[0], read.size()) && index.reads.gcount() == std::streamsize(read.size());
+}
+
+/*
+ * Loads postings of qgramm, returns false if it is not indexed or can not be read
+ */
+
+static bool Load_Postings(ExternalIndex& index, uint64_t qgramm, std::vector<int>& postings)
+{
+    auto entry = std::lower_bound(index.directory.begin(), index.directory.end(), qgramm,
+        [](const QgrammDirEntry& e, uint64_t q) { return e.qgramm < q; });
+    if(entry == index.directory.end() || entry->qgramm != qgramm) return false;
+    postings.resize(entry->count * 2);
+    index.postings.clear();
+    index.postings.seekg(entry->offset * 2 * sizeof(int));
+    size_t wanted = postings.size() * sizeof(int);
+    if(!index.postings.read(reinterpret_cast<char*>(postings.data()), wanted) ||
+       index.postings.gcount() != std::streamsize(wanted))
+    {
+        postings.clear(); return false;
+    }
+    return true;
+}
+
+void Locate_Pattern_With_MM_External(const std::string& P, ExternalIndex& index, int MM,
+        std::vector<Hit>& hits, std::vector<std::string>* hit_reads)
+{
+    hits.clear();
+    const int M = index.M; const int Q = index.Q;
+    Locate_Workspace& ws = index.ws;
+    ws.candidates_seen = 0;
+
+    for(int phase = 0; phase < M; phase++)
+    {
+	ws.PM.clear();
+	for(int i = phase; i < P.size(); i += M)
+	    ws.PM += P[i];
+	int qgramms = ws.PM.size() / Q;
+	if(qgramms == 0) continue;
+
+	if(!Load_Postings(index, Encode_Qgramm(ws.PM, 0, Q), ws.candidates)) continue;
+	for(int j = 1; j < qgramms && !ws.candidates.empty(); j++)
+	{
+	    if(!Load_Postings(index, Encode_Qgramm(ws.PM, j * Q, Q), index.loaded))
+	    {
+		ws.candidates.clear(); break;
+	    }
+	    Chain_Postings(ws.candidates, index.loaded, M * Q, ws.accepted);
+	    ws.candidates.swap(ws.accepted);
+	}
+	ws.candidates_seen += ws.candidates.size() / 2;
+
+	for(size_t x = 0; x < ws.candidates.size(); x += 2)
+	{
+	    int start = ws.candidates[x+1] - phase - (qgramms - 1) * M * Q;
+	    if(start < 0) continue;
+
+	    std::string& rd = index.read;
+	    if(!Fetch_External_Read(index, ws.candidates[x], rd)) continue;
+	    if(start + P.size() > rd.size()) continue;
+	    int mm_seen = 0;
+	    for(size_t pos = 0; pos < P.size() && mm_seen <= MM; pos++)
+		if(P[pos] != rd[start + pos]) mm_seen++;
+	    if(mm_seen > MM) continue;
+
+	    Hit hit;
+	    hit.read_id = ws.candidates[x];
+	    hit.pos = start;
+	    hit.mismatches = mm_seen;
+	    hit.strand = 0;
+	    hits.push_back(hit);
+
+	    // swapped, not copied: slot buffer of the previous call is reused for the next fetch
+	    if(!hit_reads) continue;
+	    if(hit_reads->size() < hits.size()) hit_reads->resize(hits.size());
+	    rd.swap((*hit_reads)[hits.size() - 1]);
+	}
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef TALIGNER_EXTMATCH
+#define TALIGNER_EXTMATCH
+
+#include<string>
+#include<vector>
+#include<unordered_map>
+#include<cstdint>
+
+#include<iostream>
+#include<fstream>
+
+#include "fastmatch.h"
+
+
+/*
+ *  Out-of-core variant of the Q-gramm library for read sets larger than RAM.
+ *
+ *  Index with prefix P consists of files
+ *      P.reads  - concatenated read sequences
+ *      P.roff   - uint64 offsets of reads in P.reads, n-th read spans [roff[n], roff[n+1])
+ *      P.qidx   - int pairs <read ID, position>, grouped by Q-gramm
+ *      P.qdir   - header (M, Q, reads count) followed by sorted QgrammDirEntry-s
+ *
+ *  Read IDs are those of Process_Reads_FASTQ, n-th read (0-based) of FASTQ file
+ *  gets ID 2 * n + 1, so hits are comparable with the in-memory library.
+ */
+
+/*
+ * Q-gramm packed 3 bits per nucleotide, so Q is limited to 21
+ */
+
+const int EXTMATCH_MAX_Q = 21;
+
+/*
+ * Merge of spilled runs reads each run in chunks of at least EXTMATCH_MIN_CHUNK bytes
+ * and has at most EXTMATCH_MAX_FAN_IN runs open at once, more runs are merged in passes
+ */
+
+const size_t EXTMATCH_MIN_CHUNK = 64 << 10;
+const size_t EXTMATCH_MAX_FAN_IN = 64;
+
+uint64_t Encode_Qgramm(const std::string& s, size_t start, int Q);
+
+/*
+ * One posting of the Q-gramm library as it is spilled to run files
+ */
+
+struct QgrammRecord
+{
+    uint64_t qgramm;
+    int read_id;
+    int pos;
+};
+
+/*
+ * Directory entry: postings of qgramm are count <read ID, position>
+ * pairs starting at pair number offset of P.qidx
+ */
+
+struct QgrammDirEntry
+{
+    uint64_t qgramm;
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct ExternalIndex
+{
+    int M;
+    int Q;
+    int reads_count;
+    std::vector<QgrammDirEntry> directory;
+    std::ifstream reads;
+    std::ifstream roff;
+    std::ifstream postings;
+    Locate_Workspace ws;		// query buffers, reused between calls
+    std::vector<int> loaded;
+    std::string read;
+};
+
+/*
+ * Interface function!
+ * Streams FASTQ file into the on-disk index with prefix.
+ * At most memory_budget bytes are held by Q-gramm postings at once:
+ * sorted runs are spilled to temporary files prefix.runN and then k-way merged,
+ * in several passes if the budget does not allow to open all runs at once.
+ * Returns number of reads indexed, or -1 if the index could not be written
+ * (index files are removed then).
+ */
+
+int Build_External_Index(const char* fastq, int M, int Q, size_t memory_budget,
+        const std::string& prefix);
+
+/*
+ * Opens index built by Build_External_Index, only the directory is kept in memory
+ */
+
+bool Open_External_Index(const std::string& prefix, ExternalIndex& index);
+
+/*
+ * Loads sequence of read read_id into read,
+ * returns false for unknown ID or if the index files can not be read
+ */
+
+bool Fetch_External_Read(ExternalIndex& index, int read_id, std::string& read);
+
+/*
+ * Interface function!
+ * Same as Locate_Pattern_With_MM, but served from the on-disk index.
+ * If hit_reads is given, (*hit_reads)[i] gets sequence of the read of hits[i].
+ * It is never shrunk, so strings of previous calls are reused as buffers.
+ */
+
+void Locate_Pattern_With_MM_External(const std::string& P, ExternalIndex& index, int MM,
+        std::vector<Hit>& hits, std::vector<std::string>* hit_reads = nullptr);
+
+
+#endif
@@ -1,18 +1,24 @@
 #include "fastmatch.h"
 #include "dnacommon.h"
 
+#include<algorithm>
+#include<climits>
+
 void Preprocess_Collection(int M, int Q, std::unordered_map<int, std::string>& read_collection,
         std::unordered_map<std::string, std::vector<int> >& qgramm_lib)
 {
     std::cout << "In Preprocess_Collection\n";
+    int skipped = 0;
     for(auto& x : read_collection)
     {
-        if(M * Q >= x.second.size()) continue;
+        if(M * Q >= x.second.size()) {
+            skipped++; continue;
+        }
         std::string Mr = "";
         for(size_t i = 0; i < x.second.size(); i += M)
             Mr += x.second[i];
 
-        for(size_t i = 0; i < Mr.size()-Q; i++)
+        for(size_t i = 0; i + Q <= Mr.size(); i++)
         {
             std::string qgramm = Mr.substr(i, Q);
             qgramm_lib[qgramm].push_back(x.first);	// each value of Q-gramm library
@@ -21,6 +27,21 @@ void Preprocess_Collection(int M, int Q, std::unordered_map<int, std::string>& r
 							// of Q-gramm in read's sequence
         }
     }
+    // sorted postings let the pattern finder chain Q-gramms by a linear merge
+    std::vector<std::pair<int, int> > pairs;
+    for(auto& x : qgramm_lib)
+    {
+        pairs.resize(x.second.size() / 2);
+        for(size_t i = 0; i < pairs.size(); i++)
+            pairs[i] = std::make_pair(x.second[2*i], x.second[2*i+1]);
+        std::sort(pairs.begin(), pairs.end());
+        for(size_t i = 0; i < pairs.size(); i++) {
+            x.second[2*i] = pairs[i].first; x.second[2*i+1] = pairs[i].second;
+        }
+    }
+    if(skipped > 0)
+        std::cerr << "Warning: " << skipped << " reads not longer than M * Q = " << M * Q
+                  << " are not indexed\n";
     std::cout << "Out Preprocess_Collection\n";
     // DEBUG mode lists Q-gramm lib
     // printing out Q-gramm and its parent ID - position pairs
@@ -44,52 +65,71 @@ void Preprocess_Collection(int M, int Q, std::unordered_map<int, std::string>& r
  * MULTITHREADED IMPLEMENTATION OF UNGAPPED PATTERN PRELOCATION
  */
 
-std::vector<int> Ungapped_Find_Pattern_For_One_Polyphase_Task(InnerPatternMatchTask task)
+void Chain_Postings(const std::vector<int>& candidates, const std::vector<int>& postings,
+        int shift, std::vector<int>& accepted)
 {
-    std::vector<int> results;
-    std::vector<std::string> QSP;
-    for(int i = 0; i < task.PM.size(); i += task.Q)
+    accepted.clear();
+    size_t c = 0;
+    for(size_t x = 0; x < postings.size(); x += 2)
     {
-	std::string qgr = task.PM.substr(i, task.Q);
-	if(qgr.size()==task.Q) QSP.push_back(qgr);
+	int want_pos = postings[x+1] - shift;
+	while(c < candidates.size() && (candidates[c] < postings[x] ||
+	      (candidates[c] == postings[x] && candidates[c+1] < want_pos))) c += 2;
+	if(c == candidates.size()) break;
+	if(candidates[c] == postings[x] && candidates[c+1] == want_pos)
+	{
+	    accepted.push_back(postings[x]);
+	    accepted.push_back(postings[x+1]);
+	}
     }
+}
 
-    std::vector<std::vector<int> > hits;
-    for(int j = 0; j < QSP.size(); j++)
-    {
-        auto match = task.qgramm_lib->find(QSP[j]);
-	if(match != task.qgramm_lib->end())
-	    hits.push_back(match->second);
-	else break;
-    }
+/*
+ * Chains Q-gramms of polyphase decomposition ws.PM, leaves <read ID, pattern start>
+ * pairs of putative matches in ws.candidates
+ */
 
-    if(hits.size() != QSP.size()) return results;
-
-    else for(int i = 0; i < hits.size()-1; i++) {
-	std::vector<int> accepted_hits;
-	for(int x1 = 0; x1 < hits[i+1].size(); x1 += 2) {
-	    bool accepted = false;
-	    for(int x2 = 0; x2 < hits[i].size(); x2 += 2) {
-		if(hits[i+1][x1] == hits[i][x2] &&
-		   hits[i+1][x1+1] - task.M*task.Q == hits[i][x2+1]) {
-		    accepted = true; break;
-		}
-	    }
-	    if(accepted) {
-		accepted_hits.push_back(hits[i+1][x1]);
-		accepted_hits.push_back(hits[i+1][x1+1]);
-	    }
+static void Chain_Polyphase(int phase, int M, int Q,
+        const std::unordered_map<std::string, std::vector<int> >& qgramm_lib,
+        Locate_Workspace& ws)
+{
+    ws.candidates.clear();
+    int qgramms = ws.PM.size() / Q;
+    if(qgramms == 0) return;
+
+    ws.qgramm.assign(ws.PM, 0, Q);
+    auto match = qgramm_lib.find(ws.qgramm);
+    if(match == qgramm_lib.end()) return;
+    ws.candidates.assign(match->second.begin(), match->second.end());
+
+    for(int j = 1; j < qgramms && !ws.candidates.empty(); j++)
+    {
+	ws.qgramm.assign(ws.PM, j * Q, Q);
+	match = qgramm_lib.find(ws.qgramm);
+	if(match == qgramm_lib.end()) {
+	    ws.candidates.clear(); return;
 	}
-	hits[i+1] = accepted_hits;
+	Chain_Postings(ws.candidates, match->second, M * Q, ws.accepted);
+	ws.candidates.swap(ws.accepted);
     }
-    for(int i = 0; i < hits[hits.size()-1].size(); i+=2) {
-	if(hits[hits.size()-1][i+1]-task.phase-static_cast<int>(hits.size()-1)*task.M*task.Q >= 0)
-	{
-	    results.push_back(hits[hits.size()-1][i]);
-	    results.push_back(hits[hits.size()-1][i+1]-task.phase-static_cast<int>(hits.size()-1)*task.M*task.Q);
-	}
+
+    size_t kept = 0;
+    for(size_t x = 0; x < ws.candidates.size(); x += 2)
+    {
+	int start = ws.candidates[x+1] - phase - (qgramms - 1) * M * Q;
+	if(start < 0) continue;
+	ws.candidates[kept++] = ws.candidates[x];
+	ws.candidates[kept++] = start;
     }
-    return results;
+    ws.candidates.resize(kept);
+}
+
+std::vector<int> Ungapped_Find_Pattern_For_One_Polyphase_Task(InnerPatternMatchTask task)
+{
+    Locate_Workspace ws;
+    ws.PM = task.PM;
+    Chain_Polyphase(task.phase, task.M, task.Q, *task.qgramm_lib, ws);
+    return ws.candidates;
 }
 
 std::vector<int> Ungapped_Find_Pattern(const std::string& pattern, int M, int Q,
@@ -114,27 +154,39 @@ std::vector<int> Ungapped_Find_Pattern(const std::string& pattern, int M, int Q,
     for(auto &x : job_results)
     {
 	auto result = x.get();
-	results.insert(results.begin(), result.begin(), result.end());
+	results.insert(results.end(), result.begin(), result.end());
     }
     return results;
 }
 
-bool Ungapped_Match_Pattern(const std::string& pattern, int collection_key, int pattern_start_pos,
-        std::unordered_map<int, std::string>& read_collection,
-        std::unordered_map<std::string, std::vector<int> >& qgramm_lib, int mm_count)
+/*
+ * Returns number of mismatches of pattern against read at start,
+ * counting stops at mm_count + 1
+ */
+
+static int Count_Mismatches(const std::string& pattern, const std::string& read,
+        int start, int mm_count)
 {
-    std::string putative_region = read_collection[collection_key].substr(pattern_start_pos);
-    if(pattern.size() > putative_region.size()) return false;
+    if(start < 0 || start + pattern.size() > read.size()) return mm_count + 1;
     int mm_seen = 0;
     for(size_t pos = 0; pos < pattern.size(); pos++)
     {
-    	if(pattern[pos] != putative_region[pos])
+    	if(pattern[pos] != read[start + pos])
     	{
     	    mm_seen++;
-    	    if(mm_seen > mm_count) return false;
+    	    if(mm_seen > mm_count) break;
     	}
     }
-    return true;
+    return mm_seen;
+}
+
+bool Ungapped_Match_Pattern(const std::string& pattern, int collection_key, int pattern_start_pos,
+        std::unordered_map<int, std::string>& read_collection,
+        std::unordered_map<std::string, std::vector<int> >& qgramm_lib, int mm_count)
+{
+    auto read = read_collection.find(collection_key);
+    if(read == read_collection.end()) return false;
+    return Count_Mismatches(pattern, read->second, pattern_start_pos, mm_count) <= mm_count;
 }
 
 
@@ -144,19 +196,29 @@ void Process_Reads_FASTQ(const char* fastq, int M, int Q,
         std::unordered_map<int, std::string>& read_collection,
         std::unordered_map<int, std::string>& read_names,
         std::unordered_map<std::string, std::vector<int> >& qgramm_lib)
+{
+    Process_Reads_FASTQ_Range(fastq, M, Q, 0, INT_MAX, read_collection, read_names, qgramm_lib);
+}
+
+void Process_Reads_FASTQ_Range(const char* fastq, int M, int Q, int first_read, int last_read,
+        std::unordered_map<int, std::string>& read_collection,
+        std::unordered_map<int, std::string>& read_names,
+        std::unordered_map<std::string, std::vector<int> >& qgramm_lib)
 {
     std::ifstream ifastq(fastq); std::string buffer_line;
     int line_counter = 0; int read_counter = 0;
     while(std::getline(ifastq, buffer_line, '\n')) {
+	if(line_counter / 4 >= last_read) break;
+	bool in_range = line_counter / 4 >= first_read;
 	if(line_counter % 4 == 0) {
 	    read_counter++;
-	    read_names[read_counter] = buffer_line;
+	    if(in_range) read_names[read_counter] = buffer_line;
 
 	}
 	if(line_counter % 4 == 1) {
-	    read_collection[read_counter] = buffer_line;
+	    if(in_range) read_collection[read_counter] = buffer_line;
         read_counter++;
-        read_names[read_counter] = libdna::rcDNA(buffer_line);
+        if(in_range) read_names[read_counter] = libdna::rcDNA(buffer_line);
 	}
 	line_counter++;
     }
@@ -167,25 +229,53 @@ void Process_Reads_FASTQ(const char* fastq, int M, int Q,
     Preprocess_Collection(M, Q, read_collection, qgramm_lib);
 }
 
+void Locate_Pattern_With_MM(const std::string& P, int M, int Q,
+        const std::unordered_map<int, std::string>& read_collection,
+        const std::unordered_map<std::string, std::vector<int> >& qgramm_lib, int MM,
+        std::vector<Hit>& hits, Locate_Workspace& ws)
+{
+    hits.clear();
+    ws.candidates_seen = 0;
+    for(int phase = 0; phase < M; phase++)
+    {
+	ws.PM.clear();
+	for(int i = phase; i < P.size(); i += M)
+	    ws.PM += P[i];
+	Chain_Polyphase(phase, M, Q, qgramm_lib, ws);
+	ws.candidates_seen += ws.candidates.size() / 2;
+
+	for(size_t x = 0; x < ws.candidates.size(); x += 2)
+	{
+	    auto read = read_collection.find(ws.candidates[x]);
+	    if(read == read_collection.end()) continue;
+	    int mm_seen = Count_Mismatches(P, read->second, ws.candidates[x+1], MM);
+	    if(mm_seen > MM) continue;
+
+	    Hit hit;
+	    hit.read_id = ws.candidates[x];
+	    hit.pos = ws.candidates[x+1];
+	    hit.mismatches = mm_seen;
+	    hit.strand = 0;
+	    hits.push_back(hit);
+	}
+    }
+}
+
 std::vector<std::vector<int> > Locate_Pattern_With_MM(const std::string& P, int M, int Q,
         std::unordered_map<int, std::string>& read_collection,
         std::unordered_map<std::string, std::vector<int> >& qgramm_lib, int MM)
 {
     std::vector<std::vector<int> > results;
+    std::vector<Hit> hits;
+    Locate_Workspace ws;
+    Locate_Pattern_With_MM(P, M, Q, read_collection, qgramm_lib, MM, hits, ws);
 
-    std::vector<int> preliminary_location = Ungapped_Find_Pattern(P, M, Q,
-        qgramm_lib);
-
-    for(int i = 0; i < preliminary_location.size(); i+=2)
+    for(auto& x : hits)
     {
-    	if(Ungapped_Match_Pattern(P, preliminary_location[i],
-    	    preliminary_location[i+1], read_collection, qgramm_lib, MM))
-    	{
-    	    std::vector<int> hit(2,0);
-    	    hit[0] = preliminary_location[i];
-    	    hit[1] = preliminary_location[i+1];
-    	    results.push_back(hit);
-    	}
+        std::vector<int> hit(2,0);
+        hit[0] = x.read_id;
+        hit[1] = x.pos;
+        results.push_back(hit);
     }
     return results;
 }
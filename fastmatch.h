@@ -14,6 +14,7 @@
  *  Preprocess read collection to Q-gramm library
  *  M - resize factor
  *  Q - qgramm length
+ *  Postings of each Q-gramm are sorted by <read ID, position>
  */
 void Preprocess_Collection(int M, int Q, std::unordered_map<int, std::string>& read_collection,
         std::unordered_map<std::string, std::vector<int> >& qgramm_lib);
@@ -45,6 +46,14 @@ struct InnerPatternMatchTask
     int M;
 };
 
+/*
+ * Keeps <read ID, position> pairs of postings whose position shifted back by shift
+ * is present among candidates. Both lists are sorted by <read ID, position>.
+ */
+
+void Chain_Postings(const std::vector<int>& candidates, const std::vector<int>& postings,
+        int shift, std::vector<int>& accepted);
+
 /*
  * One task matching funtion. Task is one polyphase decomposition
  */
@@ -67,6 +76,45 @@ bool Ungapped_Match_Pattern(const std::string& pattern, int collection_key, int
         std::unordered_map<int, std::string>& read_collection,
         std::unordered_map<std::string, std::vector<int> >& qgramm_lib, int mm_count = 0);
 
+/*
+ * Verified match of a pattern in reads collection.
+ * strand is 0 for forward and 1 for reverse complement read sequence,
+ * the collection holds forward reads only
+ */
+
+struct Hit
+{
+    int read_id;
+    int pos;
+    int mismatches;
+    int strand;
+};
+
+/*
+ * Buffers reused between queries of one thread, so that
+ * steady-state querying does not touch the heap
+ */
+
+struct Locate_Workspace
+{
+    std::string PM;
+    std::string qgramm;
+    std::vector<int> candidates;	// <read ID, position> pairs
+    std::vector<int> accepted;
+    size_t candidates_seen = 0;		// putative matches checked by the last query
+};
+
+/*
+ * Interface function!
+ * Writes verified matches of pattern P with at most MM mismatches
+ * to caller-owned hits buffer (it is cleared first)
+ */
+
+void Locate_Pattern_With_MM(const std::string& P, int M, int Q,
+        const std::unordered_map<int, std::string>& read_collection,
+        const std::unordered_map<std::string, std::vector<int> >& qgramm_lib, int MM,
+        std::vector<Hit>& hits, Locate_Workspace& ws);
+
 /*
  * Interface function!
  * Returns the vector of vectors <read ID, position> of verified matches
@@ -91,6 +139,17 @@ void Process_Reads_FASTQ(const char* fastq, int M, int Q,
         std::unordered_map<int, std::string>& read_names,
         std::unordered_map<std::string, std::vector<int> >& qgramm_lib);
 
+/*
+ * Same, but only reads first_read <= i < last_read (0-based, in file order) are kept.
+ * Read IDs are the same as Process_Reads_FASTQ gives them, read i has ID 2 * i + 1
+ *
+ */
+
+void Process_Reads_FASTQ_Range(const char* fastq, int M, int Q, int first_read, int last_read,
+        std::unordered_map<int, std::string>& read_collection,
+        std::unordered_map<int, std::string>& read_names,
+        std::unordered_map<std::string, std::vector<int> >& qgramm_lib);
+
 
 
 
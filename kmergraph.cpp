@@ -0,0 +1,204 @@
+#include "kmergraph.h"
+#include "dnacommon.h"
+
+static int Nucleotide_Code(char a)
+{
+    switch(a) {
+        case 'A' : case 'a' : return 0;
+        case 'C' : case 'c' : return 1;
+        case 'G' : case 'g' : return 2;
+        case 'T' : case 't' : return 3;
+        default: return -1;
+    }
+}
+
+static std::string Decode_Kmer(uint64_t kmer, int k)
+{
+    std::string seq(k, 'N');
+    for(int i = k - 1; i >= 0; i--, kmer >>= 2)
+        seq[i] = "ACGT"[kmer & 3];
+    return seq;
+}
+
+static void Count_Kmers(const std::string& read, int k,
+        std::unordered_map<uint64_t, KmerNode>& kmers)
+{
+    const uint64_t mask = (uint64_t(1) << (2 * k)) - 1;
+    uint64_t kmer = 0; int valid = 0;
+    for(size_t i = 0; i < read.size(); i++)
+    {
+        int c = Nucleotide_Code(read[i]);
+        if(c < 0) { valid = 0; continue; }
+        kmer = ((kmer << 2) | c) & mask;
+        if(++valid >= k) kmers[kmer].count++;
+    }
+}
+
+/*
+ * Solid k-mers following (forward) or preceding kmer, returns their number
+ */
+
+static int Kmer_Neighbours(const KmerGraph& graph, uint64_t kmer, bool forward, uint64_t* found)
+{
+    const uint64_t mask = (uint64_t(1) << (2 * graph.k)) - 1;
+    const KmerNode& node = graph.kmers.at(kmer);
+    unsigned char edges = forward ? node.out : node.in;
+    int n = 0;
+    for(uint64_t c = 0; c < 4; c++)
+    {
+        if(!(edges & (1 << c))) continue;
+        found[n++] = forward ? ((kmer << 2) | c) & mask : (kmer >> 2) | (c << (2 * (graph.k - 1)));
+    }
+    return n;
+}
+
+/*
+ * Grows new unitig from start k-mer through non-branching successors
+ */
+
+static void Build_Unitig(KmerGraph& graph, uint64_t start)
+{
+    int u = graph.unitigs.size();
+    graph.unitigs.push_back(Unitig());
+    Unitig& unitig = graph.unitigs.back();
+    unitig.seq = Decode_Kmer(start, graph.k);
+
+    uint64_t cur = start, found[4];
+    KmerNode* node = &graph.kmers[cur];
+    node->unitig = u; node->offset = 0;
+    long total = node->count; int offset = 0;
+    while(Kmer_Neighbours(graph, cur, true, found) == 1)
+    {
+        uint64_t next = found[0];
+        KmerNode& next_node = graph.kmers[next];
+        if(next_node.unitig >= 0 || Kmer_Neighbours(graph, next, false, found) != 1) break;
+        next_node.unitig = u; next_node.offset = ++offset;
+        total += next_node.count;
+        unitig.seq += "ACGT"[next & 3];
+        cur = next;
+    }
+    unitig.coverage = double(total) / (offset + 1);
+}
+
+void Build_Kmer_Graph(const char* fastq, int k, int min_count, KmerGraph& graph)
+{
+    std::cout << "In Build_Kmer_Graph\n";
+    if(k < KMERGRAPH_MIN_K) k = KMERGRAPH_MIN_K;
+    if(k > KMERGRAPH_MAX_K) k = KMERGRAPH_MAX_K;
+    graph.k = k;
+    graph.kmers.clear(); graph.unitigs.clear();
+
+    std::ifstream ifastq(fastq); std::string buffer_line;
+    int line_counter = 0;
+    while(std::getline(ifastq, buffer_line, '\n'))
+	if(line_counter++ % 4 == 1) Count_Kmers(buffer_line, k, graph.kmers);
+
+    for(auto x = graph.kmers.begin(); x != graph.kmers.end(); )
+    {
+        if(x->second.count < min_count) x = graph.kmers.erase(x);
+        else { x->second.unitig = -1; x->second.in = x->second.out = 0; ++x; }
+    }
+
+    // edges are looked up once, walks then use in/out masks only
+    const uint64_t mask = (uint64_t(1) << (2 * k)) - 1;
+    for(auto& x : graph.kmers)
+    {
+        for(uint64_t c = 0; c < 4; c++)
+        {
+            auto next = graph.kmers.find(((x.first << 2) | c) & mask);
+            if(next == graph.kmers.end()) continue;
+            x.second.out |= 1 << c;
+            next->second.in |= 1 << (x.first >> (2 * (k - 1)));
+        }
+    }
+
+    // unitigs start where a path branches or merges,
+    // k-mers left after that form isolated cycles
+    uint64_t found[4];
+    for(auto& x : graph.kmers)
+    {
+        if(x.second.unitig >= 0) continue;
+        if(Kmer_Neighbours(graph, x.first, false, found) != 1 ||
+           Kmer_Neighbours(graph, found[0], true, found) != 1)
+            Build_Unitig(graph, x.first);
+    }
+    for(auto& x : graph.kmers)
+        if(x.second.unitig < 0) Build_Unitig(graph, x.first);
+
+    uint64_t last = 0;
+    for(auto& unitig : graph.unitigs)
+    {
+        for(size_t i = unitig.seq.size() - k; i < unitig.seq.size(); i++)
+            last = (last << 2) | Nucleotide_Code(unitig.seq[i]);
+        last &= mask;
+        int n = Kmer_Neighbours(graph, last, true, found);
+        for(int i = 0; i < n; i++)
+            unitig.next.push_back(graph.kmers[found[i]].unitig);
+    }
+    graph.visited.assign(graph.unitigs.size(), 0);
+    graph.walk_stamp = 0;
+
+    #ifdef DEBUG_FASTMATCH
+	std::cout << "Solid k-mers: " << graph.kmers.size()
+	          << ", unitigs: " << graph.unitigs.size() << std::endl;
+    #endif
+    std::cout << "Out Build_Kmer_Graph\n";
+}
+
+int Walk_Seed_Circle(KmerGraph& graph, const std::string& seed, double branch_ratio,
+        std::string& contig)
+{
+    const int k = graph.k;
+    contig = seed;
+
+    // anchor is the last solid k-mer of the seed
+    int anchor_pos = -1;
+    std::unordered_map<uint64_t, KmerNode>::const_iterator anchor;
+    for(int a = int(seed.size()) - k; a >= 0 && anchor_pos < 0; a--)
+    {
+        uint64_t kmer = 0; int i = 0;
+        for(; i < k; i++)
+        {
+            int c = Nucleotide_Code(seed[a + i]);
+            if(c < 0) break;
+            kmer = (kmer << 2) | c;
+        }
+        if(i < k) continue;
+        anchor = graph.kmers.find(kmer);
+        if(anchor != graph.kmers.end()) anchor_pos = a;
+    }
+    if(anchor_pos < 0) return -1;
+
+    const int start = anchor->second.unitig;
+    const int start_offset = anchor->second.offset;
+    contig.resize(anchor_pos);
+    contig.append(graph.unitigs[start].seq, start_offset, std::string::npos);
+
+    int stamp = ++graph.walk_stamp;
+    graph.visited[start] = stamp;
+    for(int cur = start; ; )
+    {
+        const std::vector<int>& next = graph.unitigs[cur].next;
+        if(next.empty()) return -1;
+
+        int best = next[0]; double second = 0;
+        for(size_t i = 1; i < next.size(); i++)
+        {
+            if(graph.unitigs[next[i]].coverage > graph.unitigs[best].coverage) {
+                second = graph.unitigs[best].coverage; best = next[i];
+            }
+            else if(graph.unitigs[next[i]].coverage > second)
+                second = graph.unitigs[next[i]].coverage;
+        }
+        if(next.size() > 1 && graph.unitigs[best].coverage < branch_ratio * second)
+            return -1;					// unresolved branch
+
+        // k-mer of unitig starts k-1 before the end of contig
+        int entry_pos = contig.size() - (k - 1);
+        contig.append(graph.unitigs[best].seq, k - 1, std::string::npos);
+        if(best == start) return entry_pos + start_offset - anchor_pos;
+        if(graph.visited[best] == stamp) return -1;	// cycle misses the anchor
+        graph.visited[best] = stamp;
+        cur = best;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef TALIGNER_KMERGRAPH
+#define TALIGNER_KMERGRAPH
+
+#include<string>
+#include<vector>
+#include<unordered_map>
+#include<cstdint>
+
+#include<iostream>
+#include<fstream>
+
+
+/*
+ *  Compacted de Bruijn graph of the read set.
+ *  Nodes are unitigs - maximal non-branching paths of solid k-mers
+ *  (seen at least min_count times), consecutive unitigs overlap by k-1.
+ *  Reads are taken in forward orientation only, as in Q-gramm library.
+ */
+
+/*
+ * k-mer packed 2 bits per nucleotide, so k is limited to 31,
+ * shorter than 15 k-mers repeat by chance too often to give any unitigs
+ */
+
+const int KMERGRAPH_MIN_K = 15;
+const int KMERGRAPH_MAX_K = 31;
+
+struct Unitig
+{
+    std::string seq;
+    double coverage;		// mean count of its k-mers
+    std::vector<int> next;	// unitigs following the last k-mer
+};
+
+struct KmerNode
+{
+    int count;
+    int unitig;
+    int offset;			// of the k-mer in unitig sequence
+    unsigned char in;		// bit c is set if solid k-mer c + kmer[0, k-1) exists
+    unsigned char out;		// bit c is set if solid k-mer kmer[1, k) + c exists
+};
+
+struct KmerGraph
+{
+    int k;
+    std::unordered_map<uint64_t, KmerNode> kmers;
+    std::vector<Unitig> unitigs;
+    std::vector<int> visited;	// walk stamps per unitig
+    int walk_stamp;
+};
+
+/*
+ * Interface function!
+ * Streams reads of FASTQ file into the graph with k-mer length k,
+ * k is clamped to [KMERGRAPH_MIN_K, KMERGRAPH_MAX_K]
+ */
+
+void Build_Kmer_Graph(const char* fastq, int k, int min_count, KmerGraph& graph);
+
+/*
+ * Interface function!
+ * Anchors seed in the graph by its last solid k-mer and walks unitigs from there.
+ * At a branch the successor with the highest coverage is taken if it is at least
+ * branch_ratio times covered than any other one, otherwise the walk stops.
+ * contig gets the seed up to the anchor followed by the walked sequence.
+ * Returns circle size if the walk comes back to the anchor k-mer, -1 otherwise.
+ */
+
+int Walk_Seed_Circle(KmerGraph& graph, const std::string& seed, double branch_ratio,
+        std::string& contig);
+
+
+#endif
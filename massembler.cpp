@@ -3,84 +3,145 @@
 
 // libdna fastmatch
 #include "fastmatch.h"
+#include "extmatch.h"
+#include "overlap.h"
+#include "kmergraph.h"
+#include "autotune.h"
+#include "shardmatch.h"
 #include<algorithm>
+#include<cstdlib>
+#include<thread>
 
 using namespace std;
 using namespace libdna;
 
-// for min read length 100
-const int M = 8;    // 11
-const int Q = 8;    // 8
+// for min read length 100, overridden by --M, --Q or --autotune
+int M = 8;    // 11
+int Q = 8;    // 8
 
 
-const int L = 70; // set L, K and Z according to the assembly protocol
-const int K = 60;
-const int Z = 100;
+int L = 70; // set L, K and Z according to the assembly protocol
+int K = 60;
+int Z = 100;
 
-int Verify_Overlap(const string& Left,  int match_at_L,
-                   const string& Right, int match_at_R, int Ol)
+// buffers of seed extension, reused between steps so that
+// a step does not allocate per hit or per query
+struct Extension_Workspace
 {
-    int l_ov_s = match_at_L - match_at_R;
-    if(l_ov_s < 0) return -1;                     // L str is included in R
+    string seed_suffix;
+    vector<Hit> hits;
+    Locate_Workspace locate;
+    vector<int> votes;
+    vector<int> order;
+    vector<string> hit_reads;   // on-disk index only, read of hits[i], never shrunk
+};
 
-    int max_overlength = Left.size() - l_ov_s;
-    if(max_overlength >= Right.size()) return -2; // R str is included in L
+// will extend seed sequence 1 step forward using located hits of its L-suffix,
+// reads are taken from read_collection or, if it is not given, from ew.hit_reads
+void Extend_Seed_With_Hits(string& seed, Extension_Workspace& ew,
+    const unordered_map<int, string>* read_collection)
+{
+    auto& hits = ew.hits;
+    auto read_of = [&](int i) -> const string&
+            { return read_collection ? read_collection->at(hits[i].read_id) : ew.hit_reads[i]; };
 
-    if(Left.substr(l_ov_s, max_overlength) == Right.substr(0, max_overlength))
-        return max_overlength;
-    return 0;
+    // each hit votes for K-mer following the seed suffix in its read
+    ew.order.clear();
+    ew.votes.assign(hits.size(), 0);
+    for(int i = 0; i < hits.size(); i++)
+        if(read_of(i).size() > hits[i].pos + L + K) ew.order.push_back(i);
+
+    sort(ew.order.begin(), ew.order.end(), [&](int a, int b)
+            { return read_of(a).compare(hits[a].pos + L, K, read_of(b), hits[b].pos + L, K) < 0; });
+    for(int i = 0, j; i < ew.order.size(); i = j)
+    {
+        for(j = i + 1; j < ew.order.size() && read_of(ew.order[i]).compare(hits[ew.order[i]].pos + L, K,
+            read_of(ew.order[j]), hits[ew.order[j]].pos + L, K) == 0; j++);
+        for(int x = i; x < j; x++) ew.votes[ew.order[x]] = j - i;
+    }
+
+    // most voted first, then the ones reaching further, then by read ID,
+    // hits come in different order from shards and from a single index
+    ew.order.resize(hits.size());
+    for(int i = 0; i < hits.size(); i++) ew.order[i] = i;
+    sort(ew.order.begin(), ew.order.end(), [&](int a, int b)
+            {
+                if(ew.votes[a] != ew.votes[b]) return ew.votes[a] > ew.votes[b];
+                if(hits[a].pos != hits[b].pos) return hits[a].pos > hits[b].pos;
+                return hits[a].read_id < hits[b].read_id;
+            });
+
+    bool left_extended = false; int j = 0;
+
+    while(!left_extended && j < hits.size())
+    {
+        const string& rd = read_of(ew.order[j]);
+
+        int lol = Verify_Overlap(seed, seed.size()-L, rd, hits[ew.order[j]].pos, L);
+        if(lol > L && rd.size()-lol > K) {
+            left_extended = true;
+            seed.append(rd, lol, K);
+        }
+        j++;
+    }
 }
 
-// will extend seed sequence 1 step forward
 void Extend_Seed_At_Prime(string& seed, unordered_map<string, vector<int> >& qgramm_lib,
-    unordered_map<int, string>& read_collection)
+    unordered_map<int, string>& read_collection, Extension_Workspace& ew)
 {
     // try to extend leftward ----> (seed)
     //                           -------- (read)
     if(seed.size() < L) return;
 
-    auto seed_suffix = seed.substr(seed.size() - L, L);
+    ew.seed_suffix.assign(seed, seed.size() - L, L);
 
-    auto hits = Locate_Pattern_With_MM(seed_suffix, M, Q, read_collection, qgramm_lib, 0);
+    Locate_Pattern_With_MM(ew.seed_suffix, M, Q, read_collection, qgramm_lib, 0,
+        ew.hits, ew.locate);
+    Extend_Seed_With_Hits(seed, ew, &read_collection);
+}
 
-    map<string, int> kmer_counts;
-    int index = 0;
-    map<int, string> index2kmer;
+// same, but reads are served from the on-disk index
+void Extend_Seed_At_Prime(string& seed, ExternalIndex& index, Extension_Workspace& ew)
+{
+    if(seed.size() < L) return;
 
-    for(auto& x : hits)
-    {
-        if(read_collection[x[0]].size() > x[1] + L + K)
-        {
-            auto kmer = read_collection[x[0]].substr(x[1]+L, K);
-            kmer_counts[kmer] += 1;
-            index2kmer[index] = kmer;
-        }
-        index++;
-    }
-    index = 0;
-    for(auto& x : hits)
-    {
-        x.push_back(kmer_counts[index2kmer[index]]);
-        index++;
-    }
-    sort(hits.begin(), hits.end(), [](vector<int> a, vector<int> b)
-			{ return a[1] > b[1]; });
-    stable_sort(hits.begin(), hits.end(), [](vector<int> a, vector<int> b)
-        	{ return a[2] > b[2]; });
+    ew.seed_suffix.assign(seed, seed.size() - L, L);
 
-    bool left_extended = false; int j = 0;
+    Locate_Pattern_With_MM_External(ew.seed_suffix, index, 0, ew.hits, &ew.hit_reads);
+    Extend_Seed_With_Hits(seed, ew, nullptr);
+}
 
-    while(!left_extended && j < hits.size())
+// extends all seeds steps times, each step is one batch of queries fanned out to shards,
+// returns false if a shard stopped responding
+bool Extend_Seeds_Sharded(vector<string>& seeds, ShardPool& pool, Extension_Workspace& ew,
+    int steps)
+{
+    vector<string> suffixes;
+    vector<int> owners;
+    vector<vector<Hit> > hits;
+    unordered_map<int, string> hit_reads;   // reads of the whole batch
+    for(int k = 0; k < steps; k++)
     {
-        auto rd = read_collection[hits[j][0]];
-
-        int lol = Verify_Overlap(seed, seed.size()-L, rd, hits[j][1], L);
-        if(lol > L && rd.size()-lol > K) {
-            left_extended = true;
-            seed = seed + rd.substr(lol, K);
+        suffixes.clear(); owners.clear();
+        for(int j = 0; j < seeds.size(); j++)
+        {
+            if(seeds[j].size() < L) continue;
+            suffixes.push_back(seeds[j].substr(seeds[j].size() - L, L));
+            owners.push_back(j);
+        }
+        hit_reads.clear();
+        if(!Locate_Batch_Sharded(pool, suffixes, 0, hits, &hit_reads))
+        {
+            cerr << "Shards stopped responding\n";
+            return false;
+        }
+        for(int i = 0; i < owners.size(); i++)
+        {
+            ew.hits.swap(hits[i]);
+            Extend_Seed_With_Hits(seeds[owners[i]], ew, &hit_reads);
         }
-        j++;
     }
+    return true;
 }
 
 vector<vector<string> > Load_Seeds(const char* seedfile)
@@ -112,34 +173,192 @@ int Check_Circle(string seed, const string& prime)
 int main(int argc, char** argv)
 {
 
+    size_t ext_mem_mb = 0;
+    string index_prefix = "massembler_idx";
+    string overlaps_file;
+    int min_overlap = -1, overlap_mm = 0;
+    OverlapFormat overlap_format = OVERLAP_PAF;
+    int threads = thread::hardware_concurrency();
+    bool graph_mode = false;
+    int graph_k = 31, graph_min_count = 2;
+    double branch_ratio = 2.0;
+    bool autotune = false;
+    int tune_sample = 20000;
+    double tune_target = 0.95;
+    int shards = 0;
+    vector<string> inputs;
+    for(int a = 1; a < argc; a++)
+    {
+        string opt = argv[a];
+        if(opt.compare(0, 2, "--") != 0) inputs.push_back(opt);
+        else if(opt == "--ext-mem" && a + 1 < argc) ext_mem_mb = atol(argv[++a]);
+        else if(opt == "--index-prefix" && a + 1 < argc) index_prefix = argv[++a];
+        else if(opt == "--overlaps" && a + 1 < argc) overlaps_file = argv[++a];
+        else if(opt == "--min-overlap" && a + 1 < argc) min_overlap = atoi(argv[++a]);
+        else if(opt == "--overlap-mm" && a + 1 < argc) overlap_mm = atoi(argv[++a]);
+        else if(opt == "--overlap-format" && a + 1 < argc)
+            overlap_format = string(argv[++a]) == "bin" ? OVERLAP_BINARY : OVERLAP_PAF;
+        else if(opt == "--threads" && a + 1 < argc) threads = atoi(argv[++a]);
+        else if(opt == "--graph") graph_mode = true;
+        else if(opt == "--graph-k" && a + 1 < argc) graph_k = atoi(argv[++a]);
+        else if(opt == "--graph-min-count" && a + 1 < argc) graph_min_count = atoi(argv[++a]);
+        else if(opt == "--branch-ratio" && a + 1 < argc) branch_ratio = atof(argv[++a]);
+        else if(opt == "--M" && a + 1 < argc) M = atoi(argv[++a]);
+        else if(opt == "--Q" && a + 1 < argc) Q = atoi(argv[++a]);
+        else if(opt == "--L" && a + 1 < argc) L = atoi(argv[++a]);
+        else if(opt == "--K" && a + 1 < argc) K = atoi(argv[++a]);
+        else if(opt == "--Z" && a + 1 < argc) Z = atoi(argv[++a]);
+        else if(opt == "--autotune") autotune = true;
+        else if(opt == "--tune-sample" && a + 1 < argc) tune_sample = atoi(argv[++a]);
+        else if(opt == "--tune-target" && a + 1 < argc) tune_target = atof(argv[++a]);
+        else if(opt == "--shards" && a + 1 < argc) shards = atoi(argv[++a]);
+        else { cerr << "Unknown option " << opt << "\n"; return 1; }
+    }
+
+    if(inputs.size() != (overlaps_file.empty() ? 2 : 1) ||
+       (!overlaps_file.empty() && (ext_mem_mb > 0 || shards > 0)) ||
+       (graph_mode && (ext_mem_mb > 0 || shards > 0)) || (ext_mem_mb > 0 && shards > 0))
+    {
+        cerr << "Usage: massembler <reads.fastq> <seeds.fa> [options]\n"
+             << "       massembler <reads.fastq> --overlaps <out> [options]\n"
+             << "  --ext-mem <MB>          build out-of-core index within MB of memory\n"
+             << "  --index-prefix <P>      files prefix of out-of-core index (massembler_idx)\n"
+             << "  --overlaps <out>        write all-vs-all read overlaps instead of assembling\n"
+             << "  --min-overlap <n>       minimal overlap length (L)\n"
+             << "  --overlap-mm <n>        mismatches allowed in overlap (0), overlaps shorter\n"
+             << "                          than (n + 1) * M * Q with mismatches may be missed\n"
+             << "  --overlap-format <f>    paf or bin (paf)\n"
+             << "  --threads <n>           worker threads (all cores)\n"
+             << "  --graph                 assemble by walking compacted de Bruijn graph\n"
+             << "  --graph-k <n>           k-mer length of the graph, 15 to 31 (31)\n"
+             << "  --graph-min-count <n>   minimal count of solid k-mer (2)\n"
+             << "  --branch-ratio <x>      coverage ratio resolving a branch (2.0)\n"
+             << "  --M, --Q <n>            Q-gramm index resize factor and Q-gramm length (8, 8)\n"
+             << "  --L, --K, --Z <n>       assembly protocol: seed suffix, extension step, Z (70, 60, 100)\n"
+             << "  --autotune              choose M, Q, L and K from a sample of reads,\n"
+             << "                          overrides --M, --Q, --L and --K\n"
+             << "  --tune-sample <n>       reads sampled by --autotune (20000)\n"
+             << "  --tune-target <x>       sensitivity required by --autotune (0.95)\n"
+             << "  --shards <n>            split reads index between n worker processes\n";
+        return 1;
+    }
+    if(graph_mode && (graph_k < KMERGRAPH_MIN_K || graph_k > KMERGRAPH_MAX_K))
+    {
+        cerr << "--graph-k must be from " << KMERGRAPH_MIN_K << " to " << KMERGRAPH_MAX_K << "\n";
+        return 1;
+    }
+
     unordered_map<int, string> read_collection, read_names;
     unordered_map<string, vector<int> > qgramm_lib;
+    ExternalIndex ext_index;
+    KmerGraph graph;
+    ShardPool shard_pool;
+
+    vector<vector<string> > primers;
+    if(overlaps_file.empty())
+    {
+        primers = Load_Seeds(inputs[1].c_str());
+        cout << primers.size() << " primers to extned\n";
+    }
+
+    if(autotune)
+    {
+        vector<string> seeds;
+        for(auto& x : primers) seeds.push_back(x[0]);
+        TuneChoice choice;
+        if(!Autotune_Parameters(inputs[0].c_str(), seeds, tune_sample, tune_target, choice, cout))
+        {
+            cerr << "--autotune found no parameters for " << inputs[0] << "\n";
+            return 1;
+        }
+        M = choice.M; Q = choice.Q; L = choice.L; K = choice.K;
+    }
+    if(min_overlap < 0) min_overlap = L;
+
+    // phases of a pattern never end with M = 0, and if M * Q > L
+    // seed suffixes have no whole Q-gramm in any phase, so nothing is found
+    if(M < 1 || Q < 1 || L < 1 || K < 1)
+    {
+        cerr << "M, Q, L and K must be positive\n";
+        return 1;
+    }
+    if(overlaps_file.empty() && !graph_mode && M * Q > L)
+    {
+        cerr << "M * Q = " << M * Q << " exceeds L = " << L << ", no seed could be extended\n";
+        return 1;
+    }
+    if(ext_mem_mb > 0 && Q > EXTMATCH_MAX_Q)
+    {
+        cerr << "Q > " << EXTMATCH_MAX_Q << " is not supported by --ext-mem\n";
+        return 1;
+    }
+
+    if(!overlaps_file.empty())
+    {
+        Process_Reads_FASTQ(inputs[0].c_str(), M, Q, read_collection, read_names, qgramm_lib);
+        ofstream outovl(overlaps_file, ios::binary);
+        long overlaps = Find_All_Overlaps(M, Q, min_overlap, overlap_mm, read_collection,
+            read_names, qgramm_lib, outovl, overlap_format, threads);
+        cout << overlaps << " overlaps written to " << overlaps_file << "\n";
+        return 0;
+    }
 
-    auto primers = Load_Seeds(argv[2]);
-    cout << primers.size() << " primers to extned\n";
     // Load and hash reads
-    Process_Reads_FASTQ(argv[1], M, Q, read_collection, read_names, qgramm_lib);
+    if(graph_mode) Build_Kmer_Graph(inputs[0].c_str(), graph_k, graph_min_count, graph);
+    else if(shards > 0)
+    {
+        if(!Start_Shards(inputs[0].c_str(), M, Q, shards, shard_pool)) return 1;
+    }
+    else if(ext_mem_mb > 0)
+    {
+        if(Build_External_Index(inputs[0].c_str(), M, Q, ext_mem_mb << 20, index_prefix) < 0)
+        {
+            cerr << "Can not build index " << index_prefix << "\n";
+            return 1;
+        }
+        if(!Open_External_Index(index_prefix, ext_index))
+        {
+            cerr << "Can not open index " << index_prefix << "\n";
+            return 1;
+        }
+    }
+    else Process_Reads_FASTQ(inputs[0].c_str(), M, Q, read_collection, read_names, qgramm_lib);
     cout << "Reads loaded!\n";
 
 
-    cout << "Reads from file " << argv[1] << " hashed\n";
+    cout << "Reads from file " << inputs[0] << " hashed\n";
+    Extension_Workspace ew;
+    vector<string> seeds;
+    for(auto& x : primers) seeds.push_back(x[0]);
+    if(shards > 0)
+    {
+        // all seeds grow together, so shards get batches of queries
+        bool extended = Extend_Seeds_Sharded(seeds, shard_pool, ew, 35);
+        Stop_Shards(shard_pool);
+        if(!extended) return 1;
+    }
     ofstream outlog("miniassmL.log");
     ofstream outfas("assemblyL.fa");
-    int seed_count = 0;
     for(int j = 0; j < primers.size(); j++)
     {
         // extend each pattern
 
         string prime = primers[j][0];
-        string seed = prime;
+        string seed = seeds[j];
         string seed_name = primers[j][1];
 
         cout << "Extending seed " << seed_name << "\n";
-        for(int k = 0; k < 35; k++)
+        int circle_sz;
+        if(graph_mode) circle_sz = Walk_Seed_Circle(graph, prime, branch_ratio, seed);
+        else
         {
-            Extend_Seed_At_Prime(seed, qgramm_lib, read_collection);
+            for(int k = 0; k < 35 && shards == 0; k++)
+            {
+                if(ext_mem_mb > 0) Extend_Seed_At_Prime(seed, ext_index, ew);
+                else Extend_Seed_At_Prime(seed, qgramm_lib, read_collection, ew);
+            }
+            circle_sz = Check_Circle(seed, prime);
         }
-        int circle_sz = Check_Circle(seed, prime);
 
         if(circle_sz > 1000)
         {
@@ -0,0 +1,165 @@
+#include "overlap.h"
+#include "dnacommon.h"
+
+#include<algorithm>
+#include<future>
+
+int Verify_Overlap(const std::string& Left,  int match_at_L,
+                   const std::string& Right, int match_at_R, int Ol,
+                   int MM, int* mismatches)
+{
+    int l_ov_s = match_at_L - match_at_R;
+    if(l_ov_s < 0) return -1;                     // L str is included in R
+
+    int max_overlength = Left.size() - l_ov_s;
+    if(max_overlength >= Right.size()) return -2; // R str is included in L
+    if(max_overlength <= 0 || max_overlength < Ol) return 0;
+
+    int mm_seen = 0;
+    for(int pos = 0; pos < max_overlength; pos++)
+        if(Left[l_ov_s + pos] != Right[pos] && ++mm_seen > MM) return 0;
+    if(mismatches) *mismatches = mm_seen;
+    return max_overlength;
+}
+
+/*
+ * Finds overlaps of reads ids[first, last) as the right read.
+ * MM + 1 disjoint windows of the right read are located exactly,
+ * one of them is free of mismatches in any overlap covering all of them.
+ */
+
+static void Overlap_Block(const std::vector<int>& ids, size_t first, size_t last,
+        int M, int Q, int min_overlap, int MM,
+        const std::unordered_map<int, std::string>& read_collection,
+        const std::unordered_map<std::string, std::vector<int> >& qgramm_lib,
+        std::vector<Overlap>& found)
+{
+    Locate_Workspace ws;
+    std::vector<Hit> hits;
+    std::vector<std::pair<int, int> > candidates;	// <left read ID, left start>
+    std::string window;
+    const int window_size = std::max(M * Q, min_overlap / (MM + 1));
+    for(size_t r = first; r < last; r++)
+    {
+        const std::string& right = read_collection.at(ids[r]);
+        if(right.size() <= min_overlap) continue;   // any overlap would contain it
+
+        candidates.clear();
+        for(int w = 0; w <= MM; w++)
+        {
+            int offset = MM == 0 ? 0 : w * window_size;
+            int size = MM == 0 ? min_overlap : window_size;
+            if(offset + size > right.size()) break;
+            window.assign(right, offset, size);
+            Locate_Pattern_With_MM(window, M, Q, read_collection, qgramm_lib, MM, hits, ws);
+            for(auto& x : hits)
+                if(x.read_id != ids[r] && x.pos >= offset)
+                    candidates.push_back(std::make_pair(x.read_id, x.pos - offset));
+        }
+        if(MM > 0)
+        {
+            std::sort(candidates.begin(), candidates.end());
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        }
+
+        for(auto& x : candidates)
+        {
+            Overlap ov;
+            ov.length = Verify_Overlap(read_collection.at(x.first), x.second, right, 0,
+                min_overlap, MM, &ov.mismatches);
+            if(ov.length <= 0) continue;
+            ov.left_id = x.first;
+            ov.right_id = ids[r];
+            ov.left_start = x.second;
+            found.push_back(ov);
+        }
+    }
+}
+
+static void Write_Read_Name(std::ostream& out, const std::unordered_map<int, std::string>& read_names,
+        int read_id)
+{
+    auto name = read_names.find(read_id);
+    if(name == read_names.end() || name->second.size() < 2) {
+        out << read_id; return;
+    }
+    size_t end = name->second.find_first_of(" \t");
+    if(end == std::string::npos) end = name->second.size();
+    out.write(name->second.data() + 1, end - 1);	// drop FASTQ '@'
+}
+
+static void Write_Overlaps(std::ostream& out, OverlapFormat format, const std::vector<Overlap>& found,
+        const std::unordered_map<int, std::string>& read_collection,
+        const std::unordered_map<int, std::string>& read_names)
+{
+    if(format == OVERLAP_BINARY)
+    {
+        out.write(reinterpret_cast<const char*>(found.data()), found.size() * sizeof(Overlap));
+        return;
+    }
+    // PAF: left read is the query, right read is the target
+    for(auto& x : found)
+    {
+        int left_size = read_collection.at(x.left_id).size();
+        int right_size = read_collection.at(x.right_id).size();
+        Write_Read_Name(out, read_names, x.left_id);
+        out << "\t" << left_size << "\t" << x.left_start << "\t" << left_size << "\t+\t";
+        Write_Read_Name(out, read_names, x.right_id);
+        out << "\t" << right_size << "\t0\t" << x.length << "\t" << x.length - x.mismatches
+            << "\t" << x.length << "\t255\tNM:i:" << x.mismatches << "\n";
+    }
+}
+
+long Find_All_Overlaps(int M, int Q, int min_overlap, int MM,
+        const std::unordered_map<int, std::string>& read_collection,
+        const std::unordered_map<int, std::string>& read_names,
+        const std::unordered_map<std::string, std::vector<int> >& qgramm_lib,
+        std::ostream& out, OverlapFormat format, int threads, int block_size)
+{
+    std::cout << "In Find_All_Overlaps\n";
+    if(min_overlap < M * Q)
+        std::cerr << "Warning: min overlap " << min_overlap << " < M * Q, "
+                  << "some overlaps will be missed\n";
+    int guaranteed = (MM + 1) * std::max(M * Q, min_overlap / (MM + 1));
+    if(MM > 0 && guaranteed > min_overlap)
+        std::cerr << "Warning: overlaps shorter than " << guaranteed << " with mismatches "
+                  << "may be missed\n";
+    if(threads < 1) threads = 1;
+    if(block_size < 1) block_size = 1;
+
+    std::vector<int> ids;
+    ids.reserve(read_collection.size());
+    for(auto& x : read_collection) ids.push_back(x.first);
+    std::sort(ids.begin(), ids.end());
+
+    if(format == OVERLAP_BINARY) out.write(OVERLAP_BINARY_MAGIC, sizeof(OVERLAP_BINARY_MAGIC));
+
+    long written = 0;
+    std::vector<std::vector<Overlap> > found(threads);
+    for(size_t wave = 0; wave < ids.size(); wave += static_cast<size_t>(threads) * block_size)
+    {
+        std::vector<std::future<void> > jobs;
+        for(int t = 0; t < threads; t++)
+        {
+            size_t first = wave + static_cast<size_t>(t) * block_size;
+            if(first >= ids.size()) break;
+            size_t last = std::min(ids.size(), first + block_size);
+            found[t].clear();
+            jobs.push_back(std::async(std::launch::async, Overlap_Block, std::cref(ids),
+                first, last, M, Q, min_overlap, MM, std::cref(read_collection),
+                std::cref(qgramm_lib), std::ref(found[t])));
+        }
+        for(size_t t = 0; t < jobs.size(); t++)
+        {
+            jobs[t].get();
+            Write_Overlaps(out, format, found[t], read_collection, read_names);
+            written += found[t].size();
+        }
+        #ifdef DEBUG_FASTMATCH
+        std::cout << "Reads processed: " << std::min(ids.size(), wave + threads * block_size)
+                  << ", overlaps: " << written << std::endl;
+        #endif
+    }
+    std::cout << "Out Find_All_Overlaps\n";
+    return written;
+}
@@ -0,0 +1,66 @@
+#ifndef TALIGNER_OVERLAP
+#define TALIGNER_OVERLAP
+
+#include<string>
+#include<vector>
+#include<unordered_map>
+
+#include<iostream>
+#include<fstream>
+
+#include "fastmatch.h"
+
+
+/*
+ *  Verifies overlap of Left suffix with Right prefix, where position match_at_L
+ *  of Left is aligned to position match_at_R of Right.
+ *  Returns overlap length, -1 if Left is included in Right, -2 if Right is included
+ *  in Left, 0 if overlap is shorter than Ol or has more than MM mismatches.
+ *  Mismatches seen are stored to mismatches if given.
+ */
+
+int Verify_Overlap(const std::string& Left,  int match_at_L,
+                   const std::string& Right, int match_at_R, int Ol,
+                   int MM = 0, int* mismatches = nullptr);
+
+/*
+ * Suffix of read left_id starting at left_start is the prefix of read right_id
+ */
+
+struct Overlap
+{
+    int left_id;
+    int right_id;
+    int left_start;
+    int length;
+    int mismatches;
+};
+
+enum OverlapFormat { OVERLAP_PAF, OVERLAP_BINARY };
+
+/*
+ * Header of binary overlap list, followed by Overlap records
+ */
+
+const char OVERLAP_BINARY_MAGIC[4] = {'M', 'O', 'V', '1'};
+
+/*
+ * Interface function!
+ * Finds all suffix-prefix overlaps of at least min_overlap nucleotides with at most
+ * MM mismatches between reads of the collection and writes them to out.
+ * Prefix of each read is located in qgramm_lib (built with the same M, Q);
+ * blocks of block_size reads are processed by threads tasks at once.
+ * With MM > 0 MM + 1 disjoint windows of W = max(M * Q, min_overlap / (MM + 1)) from the
+ * start of the read are located instead, so only overlaps of at least (MM + 1) * W are all found,
+ * shorter ones are missed if every window has a mismatch at a sampled position.
+ * Returns number of overlaps written.
+ */
+
+long Find_All_Overlaps(int M, int Q, int min_overlap, int MM,
+        const std::unordered_map<int, std::string>& read_collection,
+        const std::unordered_map<int, std::string>& read_names,
+        const std::unordered_map<std::string, std::vector<int> >& qgramm_lib,
+        std::ostream& out, OverlapFormat format, int threads, int block_size = 4096);
+
+
+#endif
@@ -0,0 +1,318 @@
+#include "shardmatch.h"
+
+#include<algorithm>
+#include<cstring>
+#include<cerrno>
+#include<cstdint>
+
+#include<unistd.h>
+#include<sys/socket.h>
+#include<sys/wait.h>
+
+/*
+ * Messages in both directions are preceded by uint64 payload size
+ */
+
+static bool Send_All(int fd, const char* data, size_t size)
+{
+    while(size > 0)
+    {
+	ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+	if(sent < 0 && errno == EINTR) continue;
+	if(sent <= 0) return false;
+	data += sent; size -= sent;
+    }
+    return true;
+}
+
+static bool Recv_All(int fd, char* data, size_t size)
+{
+    while(size > 0)
+    {
+	ssize_t got = recv(fd, data, size, 0);
+	if(got < 0 && errno == EINTR) continue;
+	if(got <= 0) return false;
+	data += got; size -= got;
+    }
+    return true;
+}
+
+static void Begin_Message(std::string& message)
+{
+    message.assign(sizeof(uint64_t), '\0');
+}
+
+static void Append_Int(std::string& message, int value)
+{
+    message.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void Finish_Message(std::string& message)
+{
+    uint64_t size = message.size() - sizeof(uint64_t);
+    std::memcpy(&message[0], &size, sizeof(size));
+}
+
+static bool Recv_Message(int fd, std::string& message)
+{
+    uint64_t size;
+    if(!Recv_All(fd, reinterpret_cast<char*>(&size), sizeof(size))) return false;
+    message.resize(size);
+    return size == 0 || Recv_All(fd, &message[0], size);
+}
+
+static int Take_Int(const std::string& message, size_t& at)
+{
+    int value;
+    std::memcpy(&value, message.data() + at, sizeof(value));
+    at += sizeof(value);
+    return value;
+}
+
+/*
+ * Worker process main loop
+ */
+
+static void Serve_Shard(int fd, const char* fastq, int M, int Q, int first_read, int last_read)
+{
+    std::unordered_map<int, std::string> read_collection, read_names;
+    std::unordered_map<std::string, std::vector<int> > qgramm_lib;
+    Process_Reads_FASTQ_Range(fastq, M, Q, first_read, last_read, read_collection,
+        read_names, qgramm_lib);
+    int ready = read_collection.size();
+    if(!Send_All(fd, reinterpret_cast<const char*>(&ready), sizeof(ready))) return;
+
+    Locate_Workspace ws;
+    std::vector<Hit> hits;
+    std::vector<int> read_ids;
+    std::string request, response, pattern;
+    while(Recv_Message(fd, request))
+    {
+	size_t at = 0;
+	if(Take_Int(request, at) != SHARD_LOCATE) return;
+	int MM = Take_Int(request, at);
+	bool want_reads = Take_Int(request, at);
+	int patterns = Take_Int(request, at);
+
+	Begin_Message(response);
+	read_ids.clear();
+	for(int p = 0; p < patterns; p++)
+	{
+	    int length = Take_Int(request, at);
+	    pattern.assign(request, at, length); at += length;
+	    Locate_Pattern_With_MM(pattern, M, Q, read_collection, qgramm_lib, MM, hits, ws);
+	    Append_Int(response, hits.size());
+	    response.append(reinterpret_cast<const char*>(hits.data()), hits.size() * sizeof(Hit));
+	    if(want_reads) for(auto& x : hits) read_ids.push_back(x.read_id);
+	}
+	if(want_reads)
+	{
+	    std::sort(read_ids.begin(), read_ids.end());
+	    read_ids.erase(std::unique(read_ids.begin(), read_ids.end()), read_ids.end());
+	    Append_Int(response, read_ids.size());
+	    for(int x : read_ids)
+	    {
+		const std::string& read = read_collection.at(x);
+		Append_Int(response, x);
+		Append_Int(response, read.size());
+		response += read;
+	    }
+	}
+	Finish_Message(response);
+	if(!Send_All(fd, response.data(), response.size())) return;
+    }
+}
+
+bool Start_Shards(const char* fastq, int M, int Q, int shards, ShardPool& pool)
+{
+    pool.M = M; pool.Q = Q;
+    pool.shards.clear();
+    if(shards < 1) shards = 1;
+
+    std::ifstream ifastq(fastq); std::string buffer_line;
+    long lines = 0;
+    while(std::getline(ifastq, buffer_line, '\n')) lines++;
+    long reads = lines / 4;
+
+    for(int s = 0; s < shards; s++)
+    {
+	ShardWorker worker;
+	worker.first_read = reads * s / shards;
+	worker.last_read = reads * (s + 1) / shards;
+
+	int sv[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+	{
+	    std::cerr << "Can not create socket for shard " << s << "\n";
+	    Stop_Shards(pool); return false;
+	}
+	std::cout.flush(); std::cerr.flush();
+	pid_t pid = fork();
+	if(pid < 0)
+	{
+	    std::cerr << "Can not fork shard " << s << "\n";
+	    close(sv[0]); close(sv[1]);
+	    Stop_Shards(pool); return false;
+	}
+	if(pid == 0)
+	{
+	    close(sv[0]);
+	    for(auto& x : pool.shards) close(x.fd);
+	    Serve_Shard(sv[1], fastq, M, Q, worker.first_read, worker.last_read);
+	    close(sv[1]);
+	    std::cout.flush();
+	    _exit(0);
+	}
+	close(sv[1]);
+	worker.pid = pid; worker.fd = sv[0];
+	pool.shards.push_back(worker);
+    }
+
+    // shards index their reads in parallel, wait for all of them
+    for(size_t s = 0; s < pool.shards.size(); s++)
+    {
+	int ready;
+	if(!Recv_All(pool.shards[s].fd, reinterpret_cast<char*>(&ready), sizeof(ready)))
+	{
+	    std::cerr << "Shard " << s << " failed to start\n";
+	    Stop_Shards(pool); return false;
+	}
+	std::cout << "Shard " << s << ": reads [" << pool.shards[s].first_read << ", "
+	          << pool.shards[s].last_read << "), " << ready << " loaded\n";
+    }
+    return true;
+}
+
+void Stop_Shards(ShardPool& pool)
+{
+    Begin_Message(pool.request);
+    Append_Int(pool.request, SHARD_STOP);
+    Finish_Message(pool.request);
+    for(auto& x : pool.shards)
+    {
+	Send_All(x.fd, pool.request.data(), pool.request.size());
+	close(x.fd);
+	waitpid(x.pid, nullptr, 0);
+    }
+    pool.shards.clear();
+}
+
+bool Locate_Batch_Sharded(ShardPool& pool, const std::vector<std::string>& patterns, int MM,
+        std::vector<std::vector<Hit> >& hits, std::unordered_map<int, std::string>* hit_reads)
+{
+    Begin_Message(pool.request);
+    Append_Int(pool.request, SHARD_LOCATE);
+    Append_Int(pool.request, MM);
+    Append_Int(pool.request, hit_reads != nullptr);
+    Append_Int(pool.request, patterns.size());
+    for(auto& x : patterns)
+    {
+	Append_Int(pool.request, x.size());
+	pool.request += x;
+    }
+    Finish_Message(pool.request);
+
+    // fan out first, so that all shards work on the batch at once
+    for(auto& x : pool.shards)
+	if(!Send_All(x.fd, pool.request.data(), pool.request.size())) return false;
+
+    hits.resize(patterns.size());
+    for(auto& x : hits) x.clear();
+    for(auto& x : pool.shards)
+    {
+	if(!Recv_Message(x.fd, pool.response)) return false;
+	size_t at = 0;
+	for(size_t p = 0; p < patterns.size(); p++)
+	{
+	    int count = Take_Int(pool.response, at);
+	    size_t had = hits[p].size();
+	    hits[p].resize(had + count);
+	    std::memcpy(hits[p].data() + had, pool.response.data() + at, count * sizeof(Hit));
+	    at += count * sizeof(Hit);
+	}
+	if(!hit_reads) continue;
+	int reads = Take_Int(pool.response, at);
+	for(int r = 0; r < reads; r++)
+	{
+	    int read_id = Take_Int(pool.response, at);
+	    int length = Take_Int(pool.response, at);
+	    (*hit_reads)[read_id].assign(pool.response, at, length);
+	    at += length;
+	}
+    }
+    return true;
+}
+
+
+#ifdef SHARDMATCH
+
+#include<chrono>
+#include<cstdlib>
+
+/*
+ * Compares sharded and single process matches of read substrings
+ * shardmatch <reads.fastq> <shards> [M Q MM]
+ */
+
+int main(int argc, char** argv)
+{
+    if(argc < 3) return 1;
+    int shards = std::atoi(argv[2]);
+    int M = argc > 3 ? std::atoi(argv[3]) : 8;
+    int Q = argc > 4 ? std::atoi(argv[4]) : 8;
+    int MM = argc > 5 ? std::atoi(argv[5]) : 0;
+
+    std::unordered_map<int, std::string> collection, names;
+    std::unordered_map<std::string, std::vector<int> > qgramm_lib;
+    Process_Reads_FASTQ(argv[1], M, Q, collection, names, qgramm_lib);
+
+    std::vector<std::string> patterns;
+    for(auto& x : collection)
+    {
+	if(x.first % 7 == 1 && x.second.size() >= 80) patterns.push_back(x.second.substr(10, 70));
+	if(patterns.size() == 2000) break;
+    }
+
+    auto by_read = [](const Hit& a, const Hit& b)
+	{ return a.read_id < b.read_id || (a.read_id == b.read_id && a.pos < b.pos); };
+
+    std::vector<std::vector<Hit> > single(patterns.size());
+    Locate_Workspace ws;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t p = 0; p < patterns.size(); p++)
+	Locate_Pattern_With_MM(patterns[p], M, Q, collection, qgramm_lib, MM, single[p], ws);
+    auto single_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+	std::chrono::steady_clock::now() - start).count();
+
+    ShardPool pool;
+    if(!Start_Shards(argv[1], M, Q, shards, pool)) return 1;
+    std::vector<std::vector<Hit> > sharded, batch_hits;
+    std::vector<std::string> batch;
+    start = std::chrono::steady_clock::now();
+    for(size_t p = 0; p < patterns.size(); p += 256)
+    {
+	batch.assign(patterns.begin() + p, patterns.begin() + std::min(patterns.size(), p + 256));
+	if(!Locate_Batch_Sharded(pool, batch, MM, batch_hits)) return 1;
+	sharded.insert(sharded.end(), batch_hits.begin(), batch_hits.end());
+    }
+    auto sharded_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+	std::chrono::steady_clock::now() - start).count();
+    Stop_Shards(pool);
+
+    int differ = 0;
+    for(size_t p = 0; p < patterns.size(); p++)
+    {
+	std::sort(single[p].begin(), single[p].end(), by_read);
+	std::sort(sharded[p].begin(), sharded[p].end(), by_read);
+	bool same = single[p].size() == sharded[p].size();
+	for(size_t h = 0; same && h < single[p].size(); h++)
+	    same = !by_read(single[p][h], sharded[p][h]) && !by_read(sharded[p][h], single[p][h]);
+	if(!same) differ++;
+    }
+    std::cout << "Patterns: " << patterns.size() << ", differ: " << differ
+              << ", single: " << single_ms << " ms, " << shards << " shards: "
+              << sharded_ms << " ms" << std::endl;
+    return differ ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef TALIGNER_SHARDMATCH
+#define TALIGNER_SHARDMATCH
+
+#include<string>
+#include<vector>
+#include<unordered_map>
+
+#include<iostream>
+#include<fstream>
+
+#include<sys/types.h>
+
+#include "fastmatch.h"
+
+
+/*
+ *  Sharded Q-gramm library.
+ *  Reads are partitioned by read ID range, each shard is a forked worker process
+ *  holding its own reads collection and Q-gramm library and serving batches of
+ *  queries over a Unix socket pair. Read IDs are global, as Process_Reads_FASTQ
+ *  gives them, so hits of the shards are merged by concatenation.
+ *
+ *  Request: int op, MM, want_reads, patterns count, then per pattern int length and bytes.
+ *  Response: per pattern int hits count and Hit records, then if want_reads
+ *  int reads count and per read int ID, length and bytes.
+ *  Both are preceded by uint64 payload size.
+ */
+
+enum ShardOp { SHARD_STOP = 0, SHARD_LOCATE = 1 };
+
+struct ShardWorker
+{
+    pid_t pid;
+    int fd;
+    int first_read;	// 0-based read range [first_read, last_read) of the FASTQ
+    int last_read;
+};
+
+struct ShardPool
+{
+    int M;
+    int Q;
+    std::vector<ShardWorker> shards;
+    std::string request;	// reused between batches
+    std::string response;
+};
+
+/*
+ * Interface function!
+ * Forks shards workers, each indexing its part of FASTQ file with M, Q.
+ * Returns after all shards are ready to serve.
+ */
+
+bool Start_Shards(const char* fastq, int M, int Q, int shards, ShardPool& pool);
+
+/*
+ * Stops all workers of the pool and waits for them
+ */
+
+void Stop_Shards(ShardPool& pool);
+
+/*
+ * Interface function!
+ * Sends patterns as one batch to every shard and merges their verified matches
+ * with at most MM mismatches, hits[i] gets matches of patterns[i].
+ * If hit_reads is given, sequences of all matched reads are stored there.
+ */
+
+bool Locate_Batch_Sharded(ShardPool& pool, const std::vector<std::string>& patterns, int MM,
+        std::vector<std::vector<Hit> >& hits,
+        std::unordered_map<int, std::string>* hit_reads = nullptr);
+
+
+#endif